@@ -4,166 +4,423 @@
   Released into the public domain.
 */
 
-#include "Ardbann.h"
+#include "ardbann.h"
 
 Ardbann::Ardbann(uint16_t rawInputArray[], const uint16_t maxInput,
                  String outputArray[], const uint16_t numInputs,
                  const uint16_t numInputNeurons,
                  const uint16_t numHiddenNeurons, const uint8_t numHiddenLayers,
-                 const uint16_t numOutputNeurons)
+                 const uint16_t numOutputNeurons, WeightInit weightInit)
 {
-  float **outputLayerWeightTable = new float *[numOutputNeurons];
-  float *outputLayerBiases = new float[numOutputNeurons];
+  Allocate(numInputNeurons, numHiddenNeurons, numHiddenLayers,
+           numOutputNeurons);
 
-  randomSeed(analogRead(3));
+  network.networkResponse = 0;
+
+  network.inputLayer.numRawInputs = numInputs;
+  network.inputLayer.rawInputs = rawInputArray;
+  network.inputLayer.maxInput = maxInput;
+
+  CalculateInputNeurons(network.inputLayer.sampleRate);
+
+  network.outputLayer.stringArray = outputArray;
+
+  Seed(analogRead(3));
   // This pin should ideally be floating, change if using this pin
+  // Call Seed() and InitialiseWeights() again for a reproducible network
+
+  InitialiseWeights(weightInit);
+}
 
-  for (uint8_t i = 0; i < numOutputNeurons; i++)
+Ardbann::Ardbann(const uint16_t maxInput, String outputArray[],
+                 const uint16_t numInputNeurons,
+                 const uint16_t numHiddenNeurons, const uint8_t numHiddenLayers,
+                 const uint16_t numOutputNeurons, WeightInit weightInit)
+{
+  Allocate(numInputNeurons, numHiddenNeurons, numHiddenLayers,
+           numOutputNeurons);
+
+  network.networkResponse = 0;
+
+  // If initialising with this method, you must call NewInput()
+  // with some inputs before you can use the network, to set these
+  //
+  network.inputLayer.numRawInputs = 0;
+  network.inputLayer.rawInputs = NULL;
+  network.inputLayer.maxInput = maxInput;
+
+  network.outputLayer.stringArray = outputArray;
+
+  Seed(random(1, 0x7FFFFFFF));
+
+  InitialiseWeights(weightInit);
+}
+
+Ardbann::Ardbann(const Ardbann &other)
+{
+#ifdef __cpp_exceptions
+  // A constructor that throws never reaches the destructor, so free whatever
+  // blocks the copy managed to allocate before passing the failure on
+  try
   {
-    outputLayerWeightTable[i] = new float[numHiddenNeurons];
-    outputLayerBiases[i] = ((float)random(-1000, 1000)) / 1000;
-    for (uint16_t j = 0; j < numHiddenNeurons; j++)
-    {
-      outputLayerWeightTable[i][j] = ((float)random(-1000, 1000)) / 1000;
-    }
+    CopyFrom(other);
+  }
+  catch (...)
+  {
+    Release();
+    throw;
   }
+#else
+  CopyFrom(other);
+#endif
+}
 
-  float **hiddenLayerNeuronTable = new float *[numHiddenLayers];
-  float **hiddenLayerNeuronBiasTable = new float *[numHiddenLayers];
-  float ***hiddenLayerNeuronWeightLayerTable = new float **[numHiddenLayers];
+Ardbann::Ardbann(Ardbann &&other) noexcept { TakeFrom(other); }
 
-  for (uint8_t i = 0; i < numHiddenLayers; i++)
-  {
-    hiddenLayerNeuronWeightLayerTable[i] = new float *[numHiddenNeurons];
-    hiddenLayerNeuronTable[i] = new float[numHiddenNeurons];
-    hiddenLayerNeuronBiasTable[i] = new float[numHiddenNeurons];
+Ardbann::~Ardbann() { Release(); }
 
-    for (uint16_t j = 0; j < numHiddenNeurons; j++)
-    {
-      hiddenLayerNeuronWeightLayerTable[i][j] = new float[numInputNeurons];
-      hiddenLayerNeuronTable[i][j] = 0;
-      hiddenLayerNeuronBiasTable[i][j] = ((float)random(-1000, 1000)) / 1000;
+Ardbann &Ardbann::operator=(const Ardbann &other)
+{
+  // Copy first and only then give up our own blocks, so a failed allocation
+  // leaves this network as it was
+  if (this != &other)
+  {
+    Ardbann copy(other);
+    *this = static_cast<Ardbann &&>(copy);
+  }
+  return *this;
+}
 
-      for (uint16_t k = 0; k < numInputNeurons; k++)
-      {
-        hiddenLayerNeuronWeightLayerTable[i][j][k] =
-            ((float)random(-1000, 1000)) / 1000;
-      }
-    }
+Ardbann &Ardbann::operator=(Ardbann &&other) noexcept
+{
+  if (this != &other)
+  {
+    Release();
+    TakeFrom(other);
   }
+  return *this;
+}
+
+void Ardbann::Allocate(uint16_t numInputNeurons, uint16_t numHiddenNeurons,
+                       uint8_t numHiddenLayers, uint16_t numOutputNeurons)
+{
+  // Every weight and bias lives in one block, every neuron in another, and
+  // the layer tables only point into them. Snapshot() and Restore() can then
+  // copy the whole model at once, and a network costs five allocations.
+  uint32_t numBiases =
+      (uint32_t)numHiddenLayers * numHiddenNeurons + numOutputNeurons;
+  uint32_t numNeurons = numInputNeurons + numBiases;
+  uint16_t fanIn;
+
+  network.numWeights =
+      (uint32_t)numHiddenNeurons * (numInputNeurons + numOutputNeurons) +
+      (uint32_t)(numHiddenLayers - 1) * numHiddenNeurons * numHiddenNeurons +
+      numBiases;
+
+  // Each block goes straight into the field Release() frees it through, so
+  // a failed allocation never leaves one unowned
+  ClearBlocks();
+  network.weights = new float[network.numWeights];
+  network.inputLayer.neurons = new float[numNeurons];
+  network.inputLayer.groupThresholds = new uint16_t[2 * numInputNeurons];
+  network.hiddenLayer.neuronTable =
+      new float *[2 * numHiddenLayers + numOutputNeurons +
+                  (uint32_t)numHiddenLayers * numHiddenNeurons];
+  network.hiddenLayer.weightLayerTable = new float **[numHiddenLayers];
+
+  float *weights = network.weights;
+  float *biases = network.weights + network.numWeights - numBiases;
+  float *neurons = network.inputLayer.neurons;
+  float **tables = network.hiddenLayer.neuronTable;
+
+  memset(neurons, 0, numNeurons * sizeof(float));
 
   network.numLayers = numHiddenLayers + 2;
-  network.networkResponse = 0;
 
   network.inputLayer.numNeurons = numInputNeurons;
-  network.inputLayer.numRawInputs = numInputs;
-  network.inputLayer.neurons = new float[numInputNeurons];
-  network.inputLayer.rawInputs = rawInputArray;
-  network.inputLayer.maxInput = maxInput;
-  network.inputLayer.groupThresholds = new uint16_t[numInputNeurons];
-  network.inputLayer.groupTotal = new uint16_t[numInputNeurons];
+  network.inputLayer.groupTotal =
+      network.inputLayer.groupThresholds + numInputNeurons;
+  network.inputLayer.featureExtractor = HISTOGRAM;
+  network.inputLayer.sampleRate = 0;
+  network.inputLayer.maxFrequency = 0;
+  network.inputLayer.fftSize = 0;
+  neurons += numInputNeurons;
 
-  CalculateInputNeurons();
+  network.hiddenLayer.numNeurons = numHiddenNeurons;
+  network.hiddenLayer.numLayers = numHiddenLayers;
+  network.hiddenLayer.neuronBiasTable = tables + numHiddenLayers;
+  tables += 2 * numHiddenLayers;
+
+  for (uint8_t i = 0; i < numHiddenLayers; i++)
+  {
+    network.hiddenLayer.neuronTable[i] = neurons;
+    network.hiddenLayer.neuronBiasTable[i] = biases;
+    network.hiddenLayer.weightLayerTable[i] = tables;
+    neurons += numHiddenNeurons;
+    biases += numHiddenNeurons;
+    tables += numHiddenNeurons;
+
+    // Only the first hidden layer is fed by the input layer, the rest are
+    // fed by the hidden layer before them
+    fanIn = (i == 0) ? numInputNeurons : numHiddenNeurons;
+    for (uint16_t j = 0; j < numHiddenNeurons; j++)
+    {
+      network.hiddenLayer.weightLayerTable[i][j] = weights;
+      weights += fanIn;
+    }
+  }
 
   network.outputLayer.numNeurons = numOutputNeurons;
-  network.outputLayer.neurons = new float[numOutputNeurons];
-  network.outputLayer.weightTable = outputLayerWeightTable;
-  network.outputLayer.stringArray = outputArray;
-  network.outputLayer.neuronBiasTable = outputLayerBiases;
+  network.outputLayer.neurons = neurons;
+  network.outputLayer.neuronBiasTable = biases;
+  network.outputLayer.weightTable = tables;
 
-  network.hiddenLayer.numNeurons = numHiddenNeurons;
-  network.hiddenLayer.numLayers = numHiddenLayers;
-  network.hiddenLayer.neuronTable = hiddenLayerNeuronTable;
-  network.hiddenLayer.weightLayerTable = hiddenLayerNeuronWeightLayerTable;
-  network.hiddenLayer.neuronBiasTable = hiddenLayerNeuronBiasTable;
+  for (uint16_t i = 0; i < numOutputNeurons; i++)
+  {
+    network.outputLayer.weightTable[i] = weights;
+    weights += numHiddenNeurons;
+  }
 }
 
-Ardbann::Ardbann(const uint16_t maxInput, String outputArray[],
-                 const uint16_t numInputNeurons,
-                 const uint16_t numHiddenNeurons, const uint8_t numHiddenLayers,
-                 const uint16_t numOutputNeurons)
+void Ardbann::Release() noexcept
+{
+  // These are the bases of the blocks handed out by Allocate()
+  delete[] network.weights;
+  delete[] network.inputLayer.neurons;
+  delete[] network.inputLayer.groupThresholds;
+  delete[] network.hiddenLayer.neuronTable;
+  delete[] network.hiddenLayer.weightLayerTable;
+  delete[] network.inputLayer.fftReal;
+}
+
+void Ardbann::CopyFrom(const Ardbann &other)
+{
+  // Sizes and borrowed pointers (rawInputs, stringArray) are copied as is,
+  // then fresh blocks are allocated and filled from the other network
+  network = other.network;
+  rngState = other.rngState;
+
+  Allocate(other.network.inputLayer.numNeurons,
+           other.network.hiddenLayer.numNeurons,
+           other.network.hiddenLayer.numLayers,
+           other.network.outputLayer.numNeurons);
+
+  memcpy(network.weights, other.network.weights,
+         network.numWeights * sizeof(float));
+  memcpy(network.inputLayer.neurons, other.network.inputLayer.neurons,
+         (network.inputLayer.numNeurons +
+          (uint32_t)network.hiddenLayer.numLayers *
+              network.hiddenLayer.numNeurons +
+          network.outputLayer.numNeurons) *
+             sizeof(float));
+  memcpy(network.inputLayer.groupThresholds,
+         other.network.inputLayer.groupThresholds,
+         2 * network.inputLayer.numNeurons * sizeof(uint16_t));
+
+  network.inputLayer.featureExtractor =
+      other.network.inputLayer.featureExtractor;
+  network.inputLayer.sampleRate = other.network.inputLayer.sampleRate;
+  network.inputLayer.maxFrequency = other.network.inputLayer.maxFrequency;
+  if (other.network.inputLayer.fftSize != 0)
+  {
+    AllocateFFT(other.network.inputLayer.fftSize);
+    memcpy(network.inputLayer.fftReal, other.network.inputLayer.fftReal,
+           3 * network.inputLayer.fftSize * sizeof(float));
+  }
+}
+
+void Ardbann::TakeFrom(Ardbann &other) noexcept
+{
+  network = other.network;
+  rngState = other.rngState;
+  other.ClearBlocks();
+}
+
+void Ardbann::ClearBlocks() noexcept
 {
+  // Forgets the blocks without freeing them, once they belong elsewhere
+  network.weights = NULL;
+  network.inputLayer.neurons = NULL;
+  network.inputLayer.groupThresholds = NULL;
+  network.hiddenLayer.neuronTable = NULL;
+  network.hiddenLayer.weightLayerTable = NULL;
+  network.inputLayer.fftReal = NULL;
+}
 
-  float **outputLayerWeightTable = new float *[numOutputNeurons];
-  float *outputLayerBiases = new float[numOutputNeurons];
+void Ardbann::Seed(uint32_t seed)
+{
+  // Small seeds like 1, 2 or analogRead() values would leave xorshift's first
+  // outputs close together, so mix every bit of the seed in first
+  seed += 0x9E3779B9;
+  seed = (seed ^ (seed >> 16)) * 0x85EBCA6B;
+  seed = (seed ^ (seed >> 13)) * 0xC2B2AE35;
+  seed ^= seed >> 16;
+
+  // xorshift gets stuck on a zero state, so nudge it off
+  rngState = (seed == 0) ? 0x9E3779B9 : seed;
+}
 
-  for (uint8_t i = 0; i < numOutputNeurons; i++)
+uint32_t Ardbann::NextRandom()
+{
+  // Marsaglia xorshift32, a few shifts per number instead of a random() call
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+float Ardbann::RandomWeight(float limit)
+{
+  // Top 24 bits fill a float mantissa exactly, giving [-limit, limit)
+  return ((float)(NextRandom() >> 8) * (1.0f / 8388608.0f) - 1.0f) * limit;
+}
+
+uint16_t Ardbann::RandomIndex(uint16_t range)
+{
+  return NextRandom() % range;
+}
+
+float Ardbann::WeightLimit(WeightInit weightInit, uint16_t fanIn,
+                           uint16_t fanOut)
+{
+  // SumAndSquash squashes with tanh(x * PI), so the limits are divided by PI
+  // to keep the initial sums in the linear part of the curve
+  switch (weightInit)
   {
-    outputLayerWeightTable[i] = new float[numHiddenNeurons];
-    outputLayerBiases[i] = ((float)random(-1000, 1000)) / 1000;
-    for (uint16_t j = 0; j < numHiddenNeurons; j++)
-    {
-      outputLayerWeightTable[i][j] = ((float)random(-1000, 1000)) / 1000;
-    }
+  case XAVIER:
+    return sqrtf(6.0f / (fanIn + fanOut)) / (float)PI;
+  case HE:
+    return sqrtf(6.0f / fanIn) / (float)PI;
+  case UNIFORM:
+  default:
+    return 1.0f;
   }
+}
 
-  float **hiddenLayerNeuronTable = new float *[numHiddenLayers];
-  float **hiddenLayerNeuronBiasTable = new float *[numHiddenLayers];
-  float ***hiddenLayerNeuronWeightLayerTable = new float **[numHiddenLayers];
+void Ardbann::InitialiseWeights(WeightInit weightInit)
+{
+  float limit;
+  uint16_t fanIn;
+  uint16_t fanOut;
 
-  for (uint8_t i = 0; i < numHiddenLayers; i++)
+  for (uint8_t i = 0; i < network.hiddenLayer.numLayers; i++)
   {
-    hiddenLayerNeuronWeightLayerTable[i] = new float *[numHiddenNeurons];
-    hiddenLayerNeuronTable[i] = new float[numHiddenNeurons];
-    hiddenLayerNeuronBiasTable[i] = new float[numHiddenNeurons];
+    fanIn = (i == 0) ? network.inputLayer.numNeurons
+                     : network.hiddenLayer.numNeurons;
+    fanOut = (i == network.hiddenLayer.numLayers - 1)
+                 ? network.outputLayer.numNeurons
+                 : network.hiddenLayer.numNeurons;
+    limit = WeightLimit(weightInit, fanIn, fanOut);
 
-    for (uint16_t j = 0; j < numHiddenNeurons; j++)
+    for (uint16_t j = 0; j < network.hiddenLayer.numNeurons; j++)
     {
-      hiddenLayerNeuronWeightLayerTable[i][j] = new float[numInputNeurons];
-      hiddenLayerNeuronTable[i][j] = 0;
-      hiddenLayerNeuronBiasTable[i][j] = ((float)random(-1000, 1000)) / 1000;
-
-      for (uint16_t k = 0; k < numInputNeurons; k++)
+      network.hiddenLayer.neuronBiasTable[i][j] =
+          (weightInit == UNIFORM) ? RandomWeight(1.0f) : 0.0f;
+      for (uint16_t k = 0; k < fanIn; k++)
       {
-        hiddenLayerNeuronWeightLayerTable[i][j][k] =
-            ((float)random(-1000, 1000)) / 1000;
+        network.hiddenLayer.weightLayerTable[i][j][k] = RandomWeight(limit);
       }
     }
   }
 
-  network.numLayers = numHiddenLayers + 2;
-  network.networkResponse = 0;
-
-  // network.inputLayer.numRawInputs = numInputs;
-  // network.inputLayer.rawInputs = rawInputArray;
-  //
-  // If initialising with this method, you must call NewInput()
-  // with some inputs before you can use the network, to set these
-  //
-  network.inputLayer.numNeurons = numInputNeurons;
-  network.inputLayer.neurons = new float[numInputNeurons];
-  network.inputLayer.maxInput = maxInput;
-  network.inputLayer.groupThresholds = new uint16_t[numInputNeurons];
-  network.inputLayer.groupTotal = new uint16_t[numInputNeurons];
-
-  network.outputLayer.numNeurons = numOutputNeurons;
-  network.outputLayer.neurons = new float[numOutputNeurons];
-  network.outputLayer.weightTable = outputLayerWeightTable;
-  network.outputLayer.stringArray = outputArray;
-  network.outputLayer.neuronBiasTable = outputLayerBiases;
+  limit = WeightLimit(weightInit, network.hiddenLayer.numNeurons,
+                      network.outputLayer.numNeurons);
 
-  network.hiddenLayer.numNeurons = numHiddenNeurons;
-  network.hiddenLayer.numLayers = numHiddenLayers;
-  network.hiddenLayer.neuronTable = hiddenLayerNeuronTable;
-  network.hiddenLayer.weightLayerTable = hiddenLayerNeuronWeightLayerTable;
-  network.hiddenLayer.neuronBiasTable = hiddenLayerNeuronBiasTable;
+  for (uint16_t i = 0; i < network.outputLayer.numNeurons; i++)
+  {
+    network.outputLayer.neuronBiasTable[i] =
+        (weightInit == UNIFORM) ? RandomWeight(1.0f) : 0.0f;
+    for (uint16_t j = 0; j < network.hiddenLayer.numNeurons; j++)
+    {
+      network.outputLayer.weightTable[i][j] = RandomWeight(limit);
+    }
+  }
 }
 
 void Ardbann::NewInput(uint16_t rawInputArray[], uint16_t numInputs)
 {
   network.inputLayer.rawInputs = rawInputArray;
   network.inputLayer.numRawInputs = numInputs;
-  CalculateInputNeurons();
+  CalculateInputNeurons(network.inputLayer.sampleRate);
 }
 
 void Ardbann::NewInput(Ardbann::SampleBuffer sampleBuffer, uint16_t numInputs)
 {
   network.inputLayer.rawInputs = sampleBuffer.samples;
   network.inputLayer.numRawInputs = numInputs;
-  CalculateInputNeurons();
+  // The buffer's own rate applies to this input only, otherwise the rate
+  // given to SetFeatureExtractor() is used
+  CalculateInputNeurons((sampleBuffer.sampleRate != 0)
+                            ? sampleBuffer.sampleRate
+                            : network.inputLayer.sampleRate);
 }
 
-void Ardbann::CalculateInputNeurons()
+bool Ardbann::SetFeatureExtractor(FeatureExtractor featureExtractor,
+                                  uint16_t fftSize, uint32_t maxFrequency,
+                                  uint32_t sampleRate)
+{
+  if (featureExtractor == SPECTRAL)
+  {
+    // Bins 1 to fftSize / 2 are shared out between the input neurons
+    if ((fftSize < 4) || ((fftSize & (fftSize - 1)) != 0) ||
+        ((fftSize / 2) < network.inputLayer.numNeurons))
+    {
+      Serial.printf("\nERROR: You've asked for an FFT of %u samples, it must "
+                    "be a power of 2 with at least %u bins\n",
+                    fftSize, network.inputLayer.numNeurons);
+      return false;
+    }
+
+    if (fftSize != network.inputLayer.fftSize)
+    {
+      delete[] network.inputLayer.fftReal;
+      network.inputLayer.fftReal = NULL;
+      network.inputLayer.fftSize = 0;
+      AllocateFFT(fftSize);
+
+      for (uint16_t i = 0; i < fftSize / 2; i++)
+      {
+        network.inputLayer.twiddleCos[i] = cos(2 * PI * i / fftSize);
+        network.inputLayer.twiddleSin[i] = -sin(2 * PI * i / fftSize);
+      }
+    }
+  }
+  else
+  {
+    delete[] network.inputLayer.fftReal;
+    network.inputLayer.fftReal = NULL;
+    network.inputLayer.fftSize = 0;
+  }
+
+  network.inputLayer.featureExtractor = featureExtractor;
+  network.inputLayer.maxFrequency = maxFrequency;
+  network.inputLayer.sampleRate = sampleRate;
+  return true;
+}
+
+void Ardbann::AllocateFFT(uint16_t fftSize)
+{
+  // Real and imaginary working buffers, then fftSize / 2 of each twiddle
+  network.inputLayer.fftReal = new float[3 * fftSize];
+  network.inputLayer.fftSize = fftSize;
+  network.inputLayer.fftImag = network.inputLayer.fftReal + fftSize;
+  network.inputLayer.twiddleCos = network.inputLayer.fftImag + fftSize;
+  network.inputLayer.twiddleSin = network.inputLayer.twiddleCos + fftSize / 2;
+}
+
+void Ardbann::CalculateInputNeurons(uint32_t sampleRate)
+{
+  if (network.inputLayer.featureExtractor == SPECTRAL)
+  {
+    CalculateSpectralNeurons(sampleRate);
+  }
+  else
+  {
+    CalculateHistogramNeurons();
+  }
+}
+
+void Ardbann::CalculateHistogramNeurons()
 {
   uint8_t largestGroup = 0;
 
@@ -206,13 +463,167 @@ void Ardbann::CalculateInputNeurons()
     // Serial.printf("group total i: %u group total largest: %u ",
     //              network.inputLayer.groupTotal[i],
     //              network.inputLayer.groupTotal[largestGroup]);
-    network.inputLayer.neurons[i] = network.inputLayer.groupTotal[i] /
-                                    network.inputLayer.groupTotal[largestGroup];
+    // With no raw inputs every group is empty, leave the neurons at 0
+    // rather than dividing by it
+    if (network.inputLayer.groupTotal[largestGroup] == 0)
+    {
+      network.inputLayer.neurons[i] = 0.0f;
+    }
+    else
+    {
+      network.inputLayer.neurons[i] =
+          (float)network.inputLayer.groupTotal[i] /
+          network.inputLayer.groupTotal[largestGroup];
+    }
     // Serial.printf("input neuron %d = %.3f, ", i,
     // network.inputLayer.neurons[i]);
   }
 }
 
+void Ardbann::CalculateSpectralNeurons(uint32_t sampleRate)
+{
+  float *real = network.inputLayer.fftReal;
+  float *imag = network.inputLayer.fftImag;
+  uint16_t *frame;
+  uint16_t fftSize = network.inputLayer.fftSize;
+  uint16_t numRawInputs = network.inputLayer.numRawInputs;
+  uint16_t numSamples, frameStart = 0;
+  uint16_t lastBin = fftSize / 2;
+  uint16_t band;
+  float mean;
+  float largestBand = 0.0f;
+
+  // Bin k sits at k * sampleRate / fftSize Hz, so with a sample rate the
+  // bands can stop at maxFrequency rather than spreading up to Nyquist
+  if ((sampleRate != 0) && (network.inputLayer.maxFrequency != 0) &&
+      (network.inputLayer.maxFrequency < sampleRate / 2))
+  {
+    lastBin = ((uint32_t)network.inputLayer.maxFrequency * fftSize) /
+              sampleRate;
+    if (lastBin < network.inputLayer.numNeurons)
+    {
+      lastBin = network.inputLayer.numNeurons;
+    }
+  }
+
+  for (uint16_t i = 0; i < network.inputLayer.numNeurons; i++)
+  {
+    network.inputLayer.neurons[i] = 0.0f;
+  }
+
+  // Raw inputs longer than fftSize are cut into back to back frames, the
+  // last one lined up with the end of the buffer so no samples are dropped.
+  // Their band energies are summed, which the scaling below turns into an
+  // average. Buffers shorter than fftSize are one zero padded frame.
+  do
+  {
+    if ((numRawInputs > fftSize) && (numRawInputs - frameStart < fftSize))
+    {
+      frameStart = numRawInputs - fftSize;
+    }
+    frame = &network.inputLayer.rawInputs[frameStart];
+    numSamples = (numRawInputs - frameStart < fftSize)
+                     ? numRawInputs - frameStart
+                     : fftSize;
+
+    mean = 0.0f;
+    for (uint16_t i = 0; i < numSamples; i++)
+    {
+      mean += frame[i];
+    }
+    if (numSamples > 0)
+    {
+      mean /= numSamples;
+    }
+
+    // Take the mean off so the DC level doesn't leak into the low bands
+    for (uint16_t i = 0; i < fftSize; i++)
+    {
+      real[i] = (i < numSamples) ? frame[i] - mean : 0.0f;
+      imag[i] = 0.0f;
+    }
+
+    FFT();
+
+    for (uint16_t i = 1; i <= lastBin; i++)
+    {
+      band = ((uint32_t)(i - 1) * network.inputLayer.numNeurons) / lastBin;
+      network.inputLayer.neurons[band] +=
+          real[i] * real[i] + imag[i] * imag[i];
+    }
+
+    frameStart += numSamples;
+  } while (frameStart < numRawInputs);
+
+  for (uint16_t i = 0; i < network.inputLayer.numNeurons; i++)
+  {
+    if (network.inputLayer.neurons[i] > largestBand)
+    {
+      largestBand = network.inputLayer.neurons[i];
+    }
+  }
+
+  if (largestBand > 0.0f)
+  {
+    for (uint16_t i = 0; i < network.inputLayer.numNeurons; i++)
+    {
+      network.inputLayer.neurons[i] /= largestBand;
+    }
+  }
+}
+
+void Ardbann::FFT()
+{
+  // In-place iterative radix-2, reorder by bit reversed index then combine
+  // butterflies of length 2, 4, ... fftSize with the precomputed twiddles
+  float *real = network.inputLayer.fftReal;
+  float *imag = network.inputLayer.fftImag;
+  uint16_t fftSize = network.inputLayer.fftSize;
+  uint16_t halfLength, twiddleStep, even, odd, bit, j = 0;
+  float swap, twiddleReal, twiddleImag, twiddledReal, twiddledImag;
+
+  for (uint16_t i = 1; i < fftSize; i++)
+  {
+    for (bit = fftSize >> 1; j & bit; bit >>= 1)
+    {
+      j ^= bit;
+    }
+    j ^= bit;
+
+    if (i < j)
+    {
+      swap = real[i];
+      real[i] = real[j];
+      real[j] = swap;
+      swap = imag[i];
+      imag[i] = imag[j];
+      imag[j] = swap;
+    }
+  }
+
+  for (uint32_t length = 2; length <= fftSize; length <<= 1)
+  {
+    halfLength = length >> 1;
+    twiddleStep = fftSize / length;
+    for (uint16_t i = 0; i < fftSize; i += length)
+    {
+      for (uint16_t k = 0; k < halfLength; k++)
+      {
+        even = i + k;
+        odd = even + halfLength;
+        twiddleReal = network.inputLayer.twiddleCos[k * twiddleStep];
+        twiddleImag = network.inputLayer.twiddleSin[k * twiddleStep];
+        twiddledReal = real[odd] * twiddleReal - imag[odd] * twiddleImag;
+        twiddledImag = real[odd] * twiddleImag + imag[odd] * twiddleReal;
+        real[odd] = real[even] - twiddledReal;
+        imag[odd] = imag[even] - twiddledImag;
+        real[even] += twiddledReal;
+        imag[even] += twiddledImag;
+      }
+    }
+  }
+}
+
 uint8_t Ardbann::InputLayer()
 {
   SumAndSquash(network.inputLayer.neurons, network.hiddenLayer.neuronTable[0],
@@ -362,14 +773,13 @@ void Ardbann::PrintNetwork()
   Serial.println(network.outputLayer.stringArray[network.networkResponse]);
 }
 
-void Ardbann::TrainDriver(float learningRate, bool verbose,
-                          uint8_t numTrainingSets, uint8_t inputPin,
-                          uint16_t bufferSize, long numSeconds)
+void Ardbann::RecordTrainingData(uint16_t *trainingData,
+                                 uint8_t numTrainingSets, uint8_t inputPin,
+                                 uint16_t bufferSize)
 {
+  // trainingData is laid out as [output][training set][sample]
   String serialInput;
-  uint16_t trainingData[network.outputLayer.numNeurons][numTrainingSets]
-                       [bufferSize],
-      randomOutput, randomTrainingSet;
+  uint16_t *trainingSet;
 
   for (uint8_t i = 0; i < network.outputLayer.numNeurons; i++)
   {
@@ -384,15 +794,29 @@ void Ardbann::TrainDriver(float learningRate, bool verbose,
     for (uint8_t j = 0; j < numTrainingSets; j++)
     {
       Serial.printf("%u...", j + 1);
+      trainingSet = &trainingData[((uint32_t)i * numTrainingSets + j) *
+                                  bufferSize];
       for (uint16_t k = 0; k < bufferSize; k++)
       {
-        trainingData[i][j][k] = analogRead(inputPin);
-        Serial.printf("%u, ", trainingData[i][j][k]);
+        trainingSet[k] = analogRead(inputPin);
+        Serial.printf("%u, ", trainingSet[k]);
       }
       delay(50);
       Serial.println();
     }
   }
+}
+
+void Ardbann::TrainDriver(float learningRate, bool verbose,
+                          uint8_t numTrainingSets, uint8_t inputPin,
+                          uint16_t bufferSize, long numSeconds)
+{
+  uint16_t trainingData[network.outputLayer.numNeurons][numTrainingSets]
+                       [bufferSize],
+      randomOutput, randomTrainingSet;
+
+  RecordTrainingData(&trainingData[0][0][0], numTrainingSets, inputPin,
+                     bufferSize);
 
   if (verbose == true)
   {
@@ -402,10 +826,10 @@ void Ardbann::TrainDriver(float learningRate, bool verbose,
   unsigned long startTime = millis();
   numSeconds *= 1000;
 
-  while ((millis() - startTime) < numSeconds)
+  while ((millis() - startTime) < (unsigned long)numSeconds)
   {
-    randomOutput = random(0, network.outputLayer.numNeurons);
-    randomTrainingSet = random(0, numTrainingSets);
+    randomOutput = RandomIndex(network.outputLayer.numNeurons);
+    randomTrainingSet = RandomIndex(numTrainingSets);
     NewInput(trainingData[randomOutput][randomTrainingSet], bufferSize);
     InputLayer();
 
@@ -423,36 +847,20 @@ void Ardbann::TrainDriver(float learningRate, bool verbose,
                           uint8_t numTrainingSets, uint8_t inputPin,
                           uint16_t bufferSize, float desiredCost)
 {
-  String serialInput;
   uint16_t trainingData[network.outputLayer.numNeurons][numTrainingSets]
                        [bufferSize],
       randomOutput, randomTrainingSet;
-  float currentCost[network.outputLayer.numNeurons] = {4.0};
+  float currentCost[network.outputLayer.numNeurons];
   bool converged = false;
 
   for (uint8_t i = 0; i < network.outputLayer.numNeurons; i++)
   {
-    Serial.printf("\nAttach the sensor to material %u: ", i);
-    Serial.print(network.outputLayer.stringArray[i]);
-    serialInput = Serial.readString();
-    while (serialInput == NULL)
-    {
-      serialInput = Serial.readString();
-    }
-    Serial.println("Reading...");
-    for (uint8_t j = 0; j < numTrainingSets; j++)
-    {
-      Serial.printf("%u...", j + 1);
-      for (uint8_t k = 0; k < bufferSize; k++)
-      {
-        trainingData[i][j][k] = analogRead(inputPin);
-        Serial.printf("%u, ", trainingData[i][j][k]);
-      }
-      delay(50);
-      Serial.println();
-    }
+    currentCost[i] = 4.0;
   }
 
+  RecordTrainingData(&trainingData[0][0][0], numTrainingSets, inputPin,
+                     bufferSize);
+
   if (verbose == true)
   {
     Serial.print("\nOutput Errors: \n");
@@ -460,9 +868,8 @@ void Ardbann::TrainDriver(float learningRate, bool verbose,
 
   while (!converged)
   {
-    randomOutput = random(0, network.outputLayer.numNeurons);
-    randomTrainingSet = random(0, numTrainingSets);
-    currentCost[randomOutput] = 0.0;
+    randomOutput = RandomIndex(network.outputLayer.numNeurons);
+    randomTrainingSet = RandomIndex(numTrainingSets);
     NewInput(trainingData[randomOutput][randomTrainingSet], bufferSize);
     InputLayer();
 
@@ -473,18 +880,7 @@ void Ardbann::TrainDriver(float learningRate, bool verbose,
     }
 
     Train(randomOutput, learningRate);
-    for (uint8_t i = 0; i < network.outputLayer.numNeurons; i++)
-    {
-      if (i == randomOutput)
-      {
-        currentCost[randomOutput] += pow(1 - network.outputLayer.neurons[i], 2);
-      }
-      else
-      {
-        currentCost[randomOutput] += pow(network.outputLayer.neurons[i], 2);
-      }
-    }
-    currentCost[randomOutput] /= network.outputLayer.numNeurons;
+    currentCost[randomOutput] = Cost(randomOutput);
 
     for (uint8_t i = 0; i < network.outputLayer.numNeurons; i++)
     {
@@ -503,6 +899,166 @@ void Ardbann::TrainDriver(float learningRate, bool verbose,
   }
 }
 
+float Ardbann::TrainDriver(float learningRate, bool verbose,
+                           uint8_t numTrainingSets, uint8_t inputPin,
+                           uint16_t bufferSize, uint8_t numValidationSets,
+                           uint16_t patience, uint16_t maxEpochs)
+{
+  uint16_t trainingData[network.outputLayer.numNeurons][numTrainingSets]
+                       [bufferSize];
+
+  RecordTrainingData(&trainingData[0][0][0], numTrainingSets, inputPin,
+                     bufferSize);
+
+  return TrainEpochs(&trainingData[0][0][0], numTrainingSets, bufferSize,
+                     numValidationSets, learningRate, patience, maxEpochs,
+                     verbose);
+}
+
+float Ardbann::TrainEpochs(uint16_t *trainingData, uint8_t numTrainingSets,
+                           uint16_t bufferSize, uint8_t numValidationSets,
+                           float learningRate, uint16_t patience,
+                           uint16_t maxEpochs, bool verbose)
+{
+  // The last numValidationSets sets of every output are held out, the rest
+  // are trained on in a freshly shuffled order each epoch
+  if ((numValidationSets == 0) || (numValidationSets >= numTrainingSets))
+  {
+    Serial.printf("\nERROR: You've asked for %u validation sets when %u "
+                  "training sets exist, at least one of each is needed\n",
+                  numValidationSets, numTrainingSets);
+    return -1.0;
+  }
+
+  uint8_t numFittingSets = numTrainingSets - numValidationSets;
+  uint16_t numSamples = network.outputLayer.numNeurons * numFittingSets;
+  uint16_t sampleOrder[numSamples];
+  uint16_t swap, output, trainingSet, epochsSinceBest = 0;
+  float *bestWeights = new float[SnapshotSize()];
+  float trainingCost, validationCost;
+  float bestCost = ValidationCost(trainingData, numTrainingSets, bufferSize,
+                                  numFittingSets);
+
+  Snapshot(bestWeights);
+
+  for (uint16_t i = 0; i < numSamples; i++)
+  {
+    sampleOrder[i] = i;
+  }
+
+  if (verbose == true)
+  {
+    Serial.printf("\nEpoch | Training Cost | Validation Cost\n");
+    Serial.printf("%-6u| %-14s| %.5f\n", 0, "", bestCost);
+  }
+
+  for (uint16_t epoch = 1; epoch <= maxEpochs; epoch++)
+  {
+    for (uint16_t i = numSamples - 1; i > 0; i--)
+    {
+      swap = RandomIndex(i + 1);
+      output = sampleOrder[i];
+      sampleOrder[i] = sampleOrder[swap];
+      sampleOrder[swap] = output;
+    }
+
+    trainingCost = 0.0;
+    for (uint16_t i = 0; i < numSamples; i++)
+    {
+      output = sampleOrder[i] / numFittingSets;
+      trainingSet = sampleOrder[i] % numFittingSets;
+      NewInput(&trainingData[((uint32_t)output * numTrainingSets +
+                              trainingSet) *
+                             bufferSize],
+               bufferSize);
+      InputLayer();
+      trainingCost += Cost(output);
+      Train(output, learningRate);
+    }
+    trainingCost /= numSamples;
+
+    validationCost = ValidationCost(trainingData, numTrainingSets, bufferSize,
+                                    numFittingSets);
+
+    if (verbose == true)
+    {
+      Serial.printf("%-6u| %-14.5f| %.5f\n", epoch, trainingCost,
+                    validationCost);
+    }
+
+    if (validationCost < bestCost)
+    {
+      bestCost = validationCost;
+      epochsSinceBest = 0;
+      Snapshot(bestWeights);
+    }
+    else if (++epochsSinceBest >= patience)
+    {
+      break;
+    }
+  }
+
+  Restore(bestWeights);
+  delete[] bestWeights;
+
+  return bestCost;
+}
+
+float Ardbann::ValidationCost(uint16_t *trainingData, uint8_t numTrainingSets,
+                              uint16_t bufferSize, uint8_t firstSet)
+{
+  float totalCost = 0.0;
+
+  for (uint8_t i = 0; i < network.outputLayer.numNeurons; i++)
+  {
+    for (uint8_t j = firstSet; j < numTrainingSets; j++)
+    {
+      NewInput(&trainingData[((uint32_t)i * numTrainingSets + j) * bufferSize],
+               bufferSize);
+      InputLayer();
+      totalCost += Cost(i);
+    }
+  }
+
+  return totalCost /
+         (network.outputLayer.numNeurons * (numTrainingSets - firstSet));
+}
+
+float Ardbann::Cost(uint8_t correctOutput)
+{
+  float cost = 0.0;
+
+  for (uint8_t i = 0; i < network.outputLayer.numNeurons; i++)
+  {
+    if (i == correctOutput)
+    {
+      cost += pow(1 - network.outputLayer.neurons[i], 2);
+    }
+    else
+    {
+      cost += pow(network.outputLayer.neurons[i], 2);
+    }
+  }
+
+  return cost / network.outputLayer.numNeurons;
+}
+
+uint32_t Ardbann::SnapshotSize()
+{
+  // In floats, every weight and bias in the network
+  return network.numWeights;
+}
+
+void Ardbann::Snapshot(float *weights)
+{
+  memcpy(weights, network.weights, network.numWeights * sizeof(float));
+}
+
+void Ardbann::Restore(const float *weights)
+{
+  memcpy(network.weights, weights, network.numWeights * sizeof(float));
+}
+
 void Ardbann::Train(uint8_t correctOutput, float learningRate)
 {
   float dOutputErrorToOutputSum[network.outputLayer.numNeurons] = {0.0};
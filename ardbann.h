@@ -17,6 +17,14 @@ struct InputLayer
   uint16_t *groupThresholds;
   uint16_t *groupTotal;
   float *neurons;
+  uint8_t featureExtractor;
+  uint32_t sampleRate;
+  uint32_t maxFrequency;
+  uint16_t fftSize;
+  float *fftReal;
+  float *fftImag;
+  float *twiddleCos;
+  float *twiddleSin;
 };
 
 struct HiddenLayer
@@ -41,6 +49,8 @@ struct Network
 {
   uint16_t numLayers;
   uint16_t networkResponse;
+  uint32_t numWeights;
+  float *weights;
   InputLayer inputLayer;
   HiddenLayer hiddenLayer;
   OutputLayer outputLayer;
@@ -55,13 +65,37 @@ public:
     uint32_t sampleRate = 0;
   };
 
+  enum WeightInit
+  {
+    UNIFORM, // Every weight in [-1, 1], how the network was first built
+    XAVIER,  // Scaled by fan-in and fan-out, suits the tanh squash
+    HE       // Scaled by fan-in only
+  };
+
+  enum FeatureExtractor
+  {
+    HISTOGRAM, // Raw inputs counted into amplitude groups
+    SPECTRAL   // Energy in frequency bands of an FFT of the raw inputs
+  };
+
   Ardbann(uint16_t rawInputArray[], uint16_t maxInput, String outputArray[],
           const uint16_t numInputs, const uint16_t numInputNeurons,
           const uint16_t numHiddenNeurons, const uint8_t numHiddenLayers,
-          const uint16_t numOutputNeurons);
+          const uint16_t numOutputNeurons, WeightInit weightInit = XAVIER);
   Ardbann(uint16_t maxInput, String outputArray[],
           const uint16_t numInputNeurons, const uint16_t numHiddenNeurons,
-          const uint8_t numHiddenLayers, const uint16_t numOutputNeurons);
+          const uint8_t numHiddenLayers, const uint16_t numOutputNeurons,
+          WeightInit weightInit = XAVIER);
+  Ardbann(const Ardbann &other);
+  Ardbann(Ardbann &&other) noexcept;
+  ~Ardbann();
+  Ardbann &operator=(const Ardbann &other);
+  Ardbann &operator=(Ardbann &&other) noexcept;
+  void Seed(uint32_t seed);
+  void InitialiseWeights(WeightInit weightInit);
+  bool SetFeatureExtractor(FeatureExtractor featureExtractor,
+                           uint16_t fftSize = 0, uint32_t maxFrequency = 0,
+                           uint32_t sampleRate = 0);
   uint8_t InputLayer();
   void SumAndSquash(float *Input, float *Output, float *Bias, float **Weights,
                     uint16_t numInputs, uint16_t numOutputs);
@@ -71,6 +105,20 @@ public:
                    uint8_t inputPin, uint16_t bufferSize, long numSeconds);
   void TrainDriver(float learningRate, bool verbose, uint8_t numTrainingSets,
                    uint8_t inputPin, uint16_t bufferSize, float desiredError);
+  float TrainDriver(float learningRate, bool verbose, uint8_t numTrainingSets,
+                    uint8_t inputPin, uint16_t bufferSize,
+                    uint8_t numValidationSets, uint16_t patience,
+                    uint16_t maxEpochs);
+  float TrainEpochs(uint16_t *trainingData, uint8_t numTrainingSets,
+                    uint16_t bufferSize, uint8_t numValidationSets,
+                    float learningRate, uint16_t patience, uint16_t maxEpochs,
+                    bool verbose);
+  float ValidationCost(uint16_t *trainingData, uint8_t numTrainingSets,
+                       uint16_t bufferSize, uint8_t firstSet);
+  float Cost(uint8_t correctOutput);
+  uint32_t SnapshotSize();
+  void Snapshot(float *weights);
+  void Restore(const float *weights);
   void Train(uint8_t correctOutput, float learningRate);
   float tanhDerivative(float inputValue);
   void NewInput(uint16_t rawInputArray[], uint16_t numInputs);
@@ -82,7 +130,24 @@ public:
 
 private:
   Network network;
-  void CalculateInputNeurons();
+  uint32_t rngState;
+  void CalculateInputNeurons(uint32_t sampleRate);
+  void CalculateHistogramNeurons();
+  void CalculateSpectralNeurons(uint32_t sampleRate);
+  void FFT();
+  void AllocateFFT(uint16_t fftSize);
+  uint32_t NextRandom();
+  float RandomWeight(float limit);
+  uint16_t RandomIndex(uint16_t range);
+  float WeightLimit(WeightInit weightInit, uint16_t fanIn, uint16_t fanOut);
+  void RecordTrainingData(uint16_t *trainingData, uint8_t numTrainingSets,
+                          uint8_t inputPin, uint16_t bufferSize);
+  void Allocate(uint16_t numInputNeurons, uint16_t numHiddenNeurons,
+                uint8_t numHiddenLayers, uint16_t numOutputNeurons);
+  void Release() noexcept;
+  void CopyFrom(const Ardbann &other);
+  void TakeFrom(Ardbann &other) noexcept;
+  void ClearBlocks() noexcept;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+/*
+  Arduino.h - Host stand-in for the parts of the Arduino core Ardbann uses.
+  Lets ardbann.cpp build with a desktop compiler for the sweep tool, there
+  are no sensors so analogRead() always reads 0.
+*/
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#define PI 3.1415926535897932384626433832795
+
+class String : public std::string
+{
+public:
+  String() {}
+  String(const char *text) : std::string(text ? text : "") {}
+  String(const std::string &text) : std::string(text) {}
+  bool operator==(const char *text) const
+  {
+    return (text != NULL) && (compare(text) == 0);
+  }
+};
+
+class HostSerial
+{
+public:
+  void print(const char *text) { fputs(text, stdout); }
+  void print(const String &text) { fputs(text.c_str(), stdout); }
+  void print(double value) { printf("%.2f", value); }
+  void print(long value) { printf("%ld", value); }
+  void print(unsigned long value) { printf("%lu", value); }
+  void print(int value) { printf("%d", value); }
+  void print(unsigned int value) { printf("%u", value); }
+  template <typename T> void println(T value)
+  {
+    print(value);
+    println();
+  }
+  void println() { fputs("\n", stdout); }
+  void printf(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+  }
+  String readString()
+  {
+    std::string line;
+    std::getline(std::cin, line);
+    return String(line);
+  }
+};
+
+inline HostSerial Serial;
+
+inline uint32_t &HostRandomState()
+{
+  thread_local uint32_t state = 0x9E3779B9;
+  return state;
+}
+
+inline void randomSeed(unsigned long seed)
+{
+  HostRandomState() = (seed == 0) ? 0x9E3779B9 : seed;
+}
+
+inline long random(long minValue, long maxValue)
+{
+  uint32_t &state = HostRandomState();
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (maxValue > minValue) ? minValue + state % (maxValue - minValue)
+                               : minValue;
+}
+
+inline long random(long maxValue) { return random(0, maxValue); }
+
+inline int analogRead(uint8_t) { return 0; }
+
+inline unsigned long millis()
+{
+  static const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+inline void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+#endif
@@ -0,0 +1,729 @@
+/*
+  sweep.cpp - Host-side hyperparameter and topology sweep for Ardbann.
+  Trains every candidate network on a recorded dataset across all cores and
+  reports the Pareto front of accuracy against inference cost and memory.
+
+  Build from this directory with:
+    g++ -std=c++17 -O2 -pthread -I. -I../.. sweep.cpp ../../ardbann.cpp \
+        -o sweep
+
+  Usage:
+    sweep dataset.csv [--inputs 4,8,16] [--hidden 4,8,16] [--layers 1,2]
+          [--rates 0.01,0.05,0.1] [--seeds 1,2,3] [--test 2]
+          [--validation 2] [--patience 10] [--epochs 500]
+          [--max-input 1023] [--fft 0] [--sample-rate 0] [--max-frequency 0]
+          [--threads N] [--all]
+
+  Each line of the dataset is one training set recorded from the sensor,
+  a material name followed by its samples, e.g. "wood,512,498,530,...".
+  Every line must have the same number of samples, each no more than
+  --max-input. Outputs are numbered in the order their names first appear,
+  and every output uses as many sets as the least recorded one has.
+
+  The last --test sets of every material are never trained on, the
+  accuracy on the Pareto front is measured on them. Of the rest, the last
+  --validation sets only decide when TrainEpochs() stops, the others are
+  trained on.
+
+  Every network shape and learning rate is trained once per --seeds entry.
+  The front is built from the mean accuracy over those seeds, with the
+  worst seed shown alongside it, since a seed isn't something a deployed
+  model can choose.
+
+  --fft picks the spectral feature extractor with that FFT size instead of
+  the amplitude histogram. Its bands spread up to the Nyquist frequency,
+  or up to --max-frequency Hz when the recording's --sample-rate is given.
+  An FFT size that SetFeatureExtractor() refuses stops the sweep.
+*/
+
+#include "ardbann.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+struct Dataset
+{
+  std::vector<String> outputNames;
+  std::vector<uint16_t> samples;     // [output][training set][sample]
+  std::vector<uint16_t> testSamples; // [output][test set][sample]
+  uint8_t numTrainingSets = 0;
+  uint8_t numTestSets = 0;
+  uint16_t bufferSize = 0;
+};
+
+struct Candidate
+{
+  uint16_t numInputNeurons;
+  uint16_t numHiddenNeurons;
+  uint8_t numHiddenLayers;
+  float learningRate;
+  uint32_t seed;
+};
+
+struct Result
+{
+  Candidate candidate;
+  bool trained;
+  float validationCost;
+  float accuracy;
+  uint32_t multiplies;
+  uint32_t memoryBytes;
+};
+
+// One network shape and learning rate, summed up over every seed it was
+// trained with, since a seed can't be picked for a deployed model
+struct Summary
+{
+  Candidate candidate;
+  float meanAccuracy;
+  float worstAccuracy;
+  float validationCost;
+  uint32_t multiplies;
+  uint32_t memoryBytes;
+};
+
+struct SearchSpace
+{
+  std::vector<uint16_t> numInputNeurons = {4, 8, 16};
+  std::vector<uint16_t> numHiddenNeurons = {4, 8, 16};
+  std::vector<uint8_t> numHiddenLayers = {1, 2};
+  std::vector<float> learningRates = {0.01, 0.05, 0.1};
+  std::vector<uint32_t> seeds = {1, 2, 3};
+  uint8_t numTestSets = 2;
+  uint8_t numValidationSets = 2;
+  uint16_t patience = 10;
+  uint16_t maxEpochs = 500;
+  uint16_t maxInput = 1023;
+  uint16_t fftSize = 0;
+  uint32_t sampleRate = 0;
+  uint32_t maxFrequency = 0;
+  unsigned numThreads = std::thread::hardware_concurrency();
+  bool printAll = false;
+};
+
+// Every worker owns a queue and works from its front, when it runs dry it
+// steals from the back of someone else's. Jobs are dealt out largest first,
+// so owners start on the long runs and thieves pick up the short ones.
+class WorkStealingPool
+{
+public:
+  void Run(const std::vector<size_t> &jobs, unsigned numThreads,
+           const std::function<void(size_t)> &work)
+  {
+    std::vector<std::thread> threads;
+
+    queues = std::vector<Queue>(numThreads);
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+      queues[i % numThreads].jobs.push_back(jobs[i]);
+    }
+
+    for (unsigned i = 0; i < numThreads; i++)
+    {
+      threads.emplace_back([this, i, &work]() { Worker(i, work); });
+    }
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  std::vector<Queue> queues;
+
+  bool Pop(unsigned queueNum, bool fromFront, size_t &job)
+  {
+    std::lock_guard<std::mutex> guard(queues[queueNum].lock);
+    std::deque<size_t> &jobs = queues[queueNum].jobs;
+
+    if (jobs.empty())
+    {
+      return false;
+    }
+    if (fromFront)
+    {
+      job = jobs.front();
+      jobs.pop_front();
+    }
+    else
+    {
+      job = jobs.back();
+      jobs.pop_back();
+    }
+    return true;
+  }
+
+  void Worker(unsigned workerNum, const std::function<void(size_t)> &work)
+  {
+    size_t job;
+    bool found = true;
+
+    // No job adds more jobs, so once every queue is empty the sweep is done
+    while (found)
+    {
+      found = Pop(workerNum, true, job);
+      for (unsigned i = 1; !found && (i < queues.size()); i++)
+      {
+        found = Pop((workerNum + i) % queues.size(), false, job);
+      }
+      if (found)
+      {
+        work(job);
+      }
+    }
+  }
+};
+
+template <typename T>
+static bool ParseList(const char *text, std::vector<T> &values)
+{
+  std::stringstream stream(text);
+  std::string item;
+
+  values.clear();
+  while (std::getline(stream, item, ','))
+  {
+    std::stringstream itemStream(item);
+    double value;
+    if (!(itemStream >> value) || !(itemStream >> std::ws).eof() ||
+        (value < std::numeric_limits<T>::lowest()) ||
+        (value > std::numeric_limits<T>::max()))
+    {
+      return false;
+    }
+    values.push_back((T)value);
+  }
+  return !values.empty();
+}
+
+static bool LoadDataset(const char *path, const SearchSpace &space,
+                        Dataset &dataset)
+{
+  std::ifstream file(path);
+  std::string line;
+  size_t lineNum = 0;
+  std::map<std::string, size_t> outputNums;
+  std::vector<std::vector<std::vector<uint16_t>>> sets;
+
+  if (!file)
+  {
+    fprintf(stderr, "ERROR: Couldn't open dataset %s\n", path);
+    return false;
+  }
+
+  while (std::getline(file, line))
+  {
+    std::stringstream stream(line);
+    std::string name, item;
+    std::vector<uint16_t> samples;
+
+    lineNum++;
+    if (!std::getline(stream, name, ',') || name.empty())
+    {
+      continue;
+    }
+    while (std::getline(stream, item, ','))
+    {
+      const char *text = item.c_str();
+      char *end;
+      unsigned long sample;
+
+      while (isspace((unsigned char)*text))
+      {
+        text++;
+      }
+      sample = strtoul(text, &end, 10);
+      while (isspace((unsigned char)*end))
+      {
+        end++;
+      }
+      if (!isdigit((unsigned char)*text) || (*end != '\0'))
+      {
+        fprintf(stderr, "ERROR: \"%s\" isn't a sample, line %zu\n",
+                item.c_str(), lineNum);
+        return false;
+      }
+      if (sample > space.maxInput)
+      {
+        fprintf(stderr,
+                "ERROR: Sample %lu is over --max-input %u, line %zu\n",
+                sample, space.maxInput, lineNum);
+        return false;
+      }
+      samples.push_back((uint16_t)sample);
+    }
+
+    if (dataset.bufferSize == 0)
+    {
+      dataset.bufferSize = samples.size();
+    }
+    if ((samples.size() != dataset.bufferSize) || samples.empty())
+    {
+      fprintf(stderr,
+              "ERROR: Every set needs %u samples, this %s set has %zu, "
+              "line %zu\n",
+              dataset.bufferSize, name.c_str(), samples.size(), lineNum);
+      return false;
+    }
+
+    if (outputNums.find(name) == outputNums.end())
+    {
+      outputNums[name] = dataset.outputNames.size();
+      dataset.outputNames.push_back(String(name));
+      sets.emplace_back();
+    }
+    sets[outputNums[name]].push_back(samples);
+  }
+
+  if (dataset.outputNames.size() < 2)
+  {
+    fprintf(stderr, "ERROR: The dataset needs at least two materials\n");
+    return false;
+  }
+
+  size_t numSets = 255 + space.numTestSets;
+  for (const std::vector<std::vector<uint16_t>> &outputSets : sets)
+  {
+    numSets = std::min(numSets, outputSets.size());
+  }
+
+  if (numSets <= (size_t)space.numTestSets + space.numValidationSets)
+  {
+    fprintf(stderr,
+            "ERROR: %u test and %u validation sets leave nothing to train "
+            "on, every material has %zu sets\n",
+            space.numTestSets, space.numValidationSets, numSets);
+    return false;
+  }
+  dataset.numTrainingSets = numSets - space.numTestSets;
+  dataset.numTestSets = space.numTestSets;
+
+  for (const std::vector<std::vector<uint16_t>> &outputSets : sets)
+  {
+    if (outputSets.size() > numSets)
+    {
+      fprintf(stderr, "Using %zu of %zu sets for every material\n", numSets,
+              outputSets.size());
+    }
+    for (size_t i = 0; i < numSets; i++)
+    {
+      std::vector<uint16_t> &samples = (i < dataset.numTrainingSets)
+                                           ? dataset.samples
+                                           : dataset.testSamples;
+      samples.insert(samples.end(), outputSets[i].begin(),
+                     outputSets[i].end());
+    }
+  }
+  return true;
+}
+
+template <typename T> static bool ParseValue(const char *text, T &value)
+{
+  std::vector<T> values;
+
+  if (!ParseList(text, values) || (values.size() != 1))
+  {
+    return false;
+  }
+  value = values[0];
+  return true;
+}
+
+static bool ParseArguments(int argc, char *argv[], SearchSpace &space)
+{
+  for (int i = 2; i < argc; i++)
+  {
+    std::string option = argv[i];
+
+    if (option == "--all")
+    {
+      space.printAll = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+    {
+      fprintf(stderr, "ERROR: %s needs a value\n", argv[i]);
+      return false;
+    }
+
+    const char *text = argv[++i];
+    bool parsed;
+    if (option == "--inputs")
+    {
+      parsed = ParseList(text, space.numInputNeurons);
+    }
+    else if (option == "--hidden")
+    {
+      parsed = ParseList(text, space.numHiddenNeurons);
+    }
+    else if (option == "--layers")
+    {
+      parsed = ParseList(text, space.numHiddenLayers);
+    }
+    else if (option == "--rates")
+    {
+      parsed = ParseList(text, space.learningRates);
+    }
+    else if (option == "--seeds")
+    {
+      parsed = ParseList(text, space.seeds);
+    }
+    else if (option == "--test")
+    {
+      parsed = ParseValue(text, space.numTestSets);
+    }
+    else if (option == "--validation")
+    {
+      parsed = ParseValue(text, space.numValidationSets);
+    }
+    else if (option == "--patience")
+    {
+      parsed = ParseValue(text, space.patience);
+    }
+    else if (option == "--epochs")
+    {
+      parsed = ParseValue(text, space.maxEpochs);
+    }
+    else if (option == "--max-input")
+    {
+      parsed = ParseValue(text, space.maxInput);
+    }
+    else if (option == "--fft")
+    {
+      parsed = ParseValue(text, space.fftSize);
+    }
+    else if (option == "--sample-rate")
+    {
+      parsed = ParseValue(text, space.sampleRate);
+    }
+    else if (option == "--max-frequency")
+    {
+      parsed = ParseValue(text, space.maxFrequency);
+    }
+    else if (option == "--threads")
+    {
+      parsed = ParseValue(text, space.numThreads);
+    }
+    else
+    {
+      fprintf(stderr, "ERROR: Unknown option %s\n", argv[i - 1]);
+      return false;
+    }
+
+    if (!parsed)
+    {
+      fprintf(stderr, "ERROR: Couldn't read %s %s\n", argv[i - 1], text);
+      return false;
+    }
+  }
+
+  if ((space.numTestSets == 0) || (space.numValidationSets == 0))
+  {
+    fprintf(stderr, "ERROR: --test and --validation need at least 1 set\n");
+    return false;
+  }
+
+  if ((std::count(space.numInputNeurons.begin(), space.numInputNeurons.end(),
+                  0) != 0) ||
+      (std::count(space.numHiddenNeurons.begin(),
+                  space.numHiddenNeurons.end(), 0) != 0) ||
+      (std::count(space.numHiddenLayers.begin(), space.numHiddenLayers.end(),
+                  0) != 0))
+  {
+    fprintf(stderr,
+            "ERROR: --inputs, --hidden and --layers can't include 0\n");
+    return false;
+  }
+
+  if (space.numThreads == 0)
+  {
+    space.numThreads = 1;
+  }
+  return true;
+}
+
+static uint32_t Multiplies(const Candidate &candidate, uint16_t numOutputs,
+                           uint16_t fftSize, uint16_t bufferSize)
+{
+  // Weight multiplies in one InputLayer() pass, the tanh calls scale with it.
+  // The FFT adds four per butterfly, fftSize / 2 butterflies per stage, for
+  // every fftSize frame the buffer is cut into. The histogram has no FFT.
+  uint32_t multiplies =
+      (uint32_t)candidate.numInputNeurons * candidate.numHiddenNeurons +
+      (uint32_t)(candidate.numHiddenLayers - 1) * candidate.numHiddenNeurons *
+          candidate.numHiddenNeurons +
+      (uint32_t)candidate.numHiddenNeurons * numOutputs;
+
+  if (fftSize == 0)
+  {
+    return multiplies;
+  }
+
+  uint32_t numFrames =
+      (bufferSize > fftSize) ? (bufferSize + fftSize - 1) / fftSize : 1;
+  for (uint32_t length = 2; length <= fftSize; length <<= 1)
+  {
+    multiplies += 2 * numFrames * fftSize;
+  }
+  return multiplies;
+}
+
+static Result TrainCandidate(const Candidate &candidate, Dataset &dataset,
+                             const SearchSpace &space)
+{
+  uint16_t numOutputs = dataset.outputNames.size();
+  uint16_t numCorrect = 0;
+  Result result;
+
+  Ardbann ardbann(space.maxInput, dataset.outputNames.data(),
+                  candidate.numInputNeurons, candidate.numHiddenNeurons,
+                  candidate.numHiddenLayers, numOutputs);
+  ardbann.Seed(candidate.seed);
+  ardbann.InitialiseWeights(Ardbann::XAVIER);
+  result.candidate = candidate;
+  result.trained =
+      (space.fftSize == 0) ||
+      ardbann.SetFeatureExtractor(Ardbann::SPECTRAL, space.fftSize,
+                                  space.maxFrequency, space.sampleRate);
+  if (!result.trained)
+  {
+    return result;
+  }
+
+  result.validationCost = ardbann.TrainEpochs(
+      dataset.samples.data(), dataset.numTrainingSets, dataset.bufferSize,
+      space.numValidationSets, candidate.learningRate, space.patience,
+      space.maxEpochs, false);
+
+  for (uint16_t i = 0; i < numOutputs; i++)
+  {
+    for (uint8_t j = 0; j < dataset.numTestSets; j++)
+    {
+      ardbann.NewInput(
+          &dataset.testSamples[((size_t)i * dataset.numTestSets + j) *
+                               dataset.bufferSize],
+          dataset.bufferSize);
+      if (ardbann.InputLayer() == i)
+      {
+        numCorrect++;
+      }
+    }
+  }
+
+  result.accuracy =
+      (float)numCorrect / (numOutputs * dataset.numTestSets);
+  result.multiplies = Multiplies(candidate, numOutputs, space.fftSize,
+                                 dataset.bufferSize);
+  // Weights and biases, the neuron values and the FFT buffers and twiddles,
+  // as floats on the device
+  result.memoryBytes =
+      (ardbann.SnapshotSize() + candidate.numInputNeurons +
+       (uint32_t)candidate.numHiddenLayers * candidate.numHiddenNeurons +
+       numOutputs + 3 * (uint32_t)space.fftSize) *
+      4;
+  return result;
+}
+
+static Summary Summarise(const Result *results, size_t numSeeds)
+{
+  Summary summary;
+
+  summary.candidate = results[0].candidate;
+  summary.meanAccuracy = 0.0f;
+  summary.worstAccuracy = results[0].accuracy;
+  summary.validationCost = 0.0f;
+  summary.multiplies = results[0].multiplies;
+  summary.memoryBytes = results[0].memoryBytes;
+
+  for (size_t i = 0; i < numSeeds; i++)
+  {
+    summary.meanAccuracy += results[i].accuracy / numSeeds;
+    summary.worstAccuracy =
+        std::min(summary.worstAccuracy, results[i].accuracy);
+    summary.validationCost += results[i].validationCost / numSeeds;
+  }
+  return summary;
+}
+
+static bool Dominates(const Summary &a, const Summary &b)
+{
+  return (a.meanAccuracy >= b.meanAccuracy) &&
+         (a.multiplies <= b.multiplies) && (a.memoryBytes <= b.memoryBytes) &&
+         ((a.meanAccuracy > b.meanAccuracy) || (a.multiplies < b.multiplies) ||
+          (a.memoryBytes < b.memoryBytes));
+}
+
+static void PrintSummary(const Summary &summary)
+{
+  printf("%-7u| %-7u| %-7u| %-8.4f| %-10.3f| %-10.3f| %-11.5f| %-11u| %u\n",
+         summary.candidate.numInputNeurons, summary.candidate.numHiddenNeurons,
+         summary.candidate.numHiddenLayers, summary.candidate.learningRate,
+         summary.meanAccuracy, summary.worstAccuracy, summary.validationCost,
+         summary.multiplies, summary.memoryBytes);
+}
+
+static void PrintHeader()
+{
+  printf("Inputs | Hidden | Layers | Rate    | Mean Acc. | Worst Acc.| "
+         "Val. Cost  | Multiplies | Bytes\n");
+}
+
+int main(int argc, char *argv[])
+{
+  Dataset dataset;
+  SearchSpace space;
+  std::vector<Candidate> candidates;
+  std::vector<Result> results;
+  std::vector<Summary> summaries;
+  std::vector<size_t> jobs;
+  std::atomic<size_t> numDone(0);
+  std::mutex printLock;
+  WorkStealingPool pool;
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s dataset.csv [options], see sweep.cpp\n",
+            argv[0]);
+    return 1;
+  }
+  if (!ParseArguments(argc, argv, space) ||
+      !LoadDataset(argv[1], space, dataset))
+  {
+    return 1;
+  }
+  // Let the library decide which FFT sizes it takes, it prints the reason
+  for (uint16_t numInputNeurons : space.numInputNeurons)
+  {
+    if (space.fftSize == 0)
+    {
+      break;
+    }
+
+    Ardbann probe(space.maxInput, dataset.outputNames.data(), numInputNeurons,
+                  1, 1, dataset.outputNames.size());
+    if (!probe.SetFeatureExtractor(Ardbann::SPECTRAL, space.fftSize,
+                                   space.maxFrequency, space.sampleRate))
+    {
+      fprintf(stderr, "ERROR: --fft %u can't be used with %u input neurons\n",
+              space.fftSize, numInputNeurons);
+      return 1;
+    }
+  }
+  if ((space.maxFrequency != 0) &&
+      ((space.fftSize == 0) || (space.sampleRate == 0) ||
+       (space.maxFrequency >= space.sampleRate / 2)))
+  {
+    fprintf(stderr,
+            "ERROR: --max-frequency %u needs --fft and a --sample-rate over "
+            "twice it\n",
+            space.maxFrequency);
+    return 1;
+  }
+
+  for (uint16_t numInputNeurons : space.numInputNeurons)
+    for (uint16_t numHiddenNeurons : space.numHiddenNeurons)
+      for (uint8_t numHiddenLayers : space.numHiddenLayers)
+        for (float learningRate : space.learningRates)
+          for (uint32_t seed : space.seeds)
+          {
+            candidates.push_back({numInputNeurons, numHiddenNeurons,
+                                  numHiddenLayers, learningRate, seed});
+            jobs.push_back(jobs.size());
+          }
+
+  // Bigger networks take longer per epoch, hand them out first
+  std::stable_sort(jobs.begin(), jobs.end(), [&](size_t a, size_t b) {
+    return Multiplies(candidates[a], dataset.outputNames.size(), 0, 0) >
+           Multiplies(candidates[b], dataset.outputNames.size(), 0, 0);
+  });
+
+  fprintf(stderr,
+          "Training %zu networks on %u threads, %zu materials x (%u + %u "
+          "test) sets x %u samples\n",
+          candidates.size(), space.numThreads, dataset.outputNames.size(),
+          dataset.numTrainingSets, dataset.numTestSets, dataset.bufferSize);
+
+  results.resize(candidates.size());
+  pool.Run(jobs, space.numThreads, [&](size_t job) {
+    results[job] = TrainCandidate(candidates[job], dataset, space);
+
+    std::lock_guard<std::mutex> guard(printLock);
+    fprintf(stderr, "\r%zu/%zu", ++numDone, candidates.size());
+  });
+  fprintf(stderr, "\n");
+
+  for (const Result &result : results)
+  {
+    if (!result.trained)
+    {
+      fprintf(stderr, "ERROR: The spectral feature extractor was refused\n");
+      return 1;
+    }
+  }
+
+  // Candidates were laid out with the seed varying fastest, so each run of
+  // seeds.size() results is one network shape and learning rate
+  for (size_t i = 0; i < results.size(); i += space.seeds.size())
+  {
+    summaries.push_back(Summarise(&results[i], space.seeds.size()));
+  }
+
+  std::sort(summaries.begin(), summaries.end(),
+            [](const Summary &a, const Summary &b) {
+              if (a.memoryBytes != b.memoryBytes)
+              {
+                return a.memoryBytes < b.memoryBytes;
+              }
+              return a.validationCost < b.validationCost;
+            });
+
+  if (space.printAll)
+  {
+    printf("\nAll networks, over %zu seeds each:\n", space.seeds.size());
+    PrintHeader();
+    for (const Summary &summary : summaries)
+    {
+      PrintSummary(summary);
+    }
+  }
+
+  printf("\nPareto front, mean accuracy over %zu seeds on the %u held out "
+         "test sets per material against multiplies per inference and "
+         "model bytes:\n",
+         space.seeds.size(), dataset.numTestSets);
+  PrintHeader();
+  for (const Summary &summary : summaries)
+  {
+    bool dominated = false;
+    for (const Summary &other : summaries)
+    {
+      if (Dominates(other, summary))
+      {
+        dominated = true;
+        break;
+      }
+    }
+    if (!dominated)
+    {
+      PrintSummary(summary);
+    }
+  }
+
+  return 0;
+}